@@ -67,14 +67,45 @@ PROGMEM const Tile spriteT []= {
 
 const Tile* blocks[] = {spriteL, spriteZ, spriteI, spriteS, spriteT}; 
 
+/**
+ * @brief states of the block game.
+ * Landing a block is spread over several steps, each with a bounded amount of work.
+ * Thus a tick never takes longer, no matter how many lines get cleared.
+ */
+#define BG_STATE_FALLING 0
+#define BG_STATE_LOCK 1
+#define BG_STATE_MARK 2
+#define BG_STATE_FLASH 3
+#define BG_STATE_COMPACT 4
+#define BG_STATE_SPAWN 5
+#define BG_STATE_GAME_OVER 6
+
+// blocks are at most 4 pixels wide, thus only from this shift on they spill into the next byte
+#define BG_SHIFT_SPILL 5
+
+// toggle the full lines every BG_FLASH_STEPS steps, BG_FLASH_TOGGLES times
+#define BG_FLASH_STEPS 4
+#define BG_FLASH_TOGGLES 6
+
 FrameBuffer landed;
 uint8_t landedMem[MAX7219_MODULE_COUNT*8] = {0,}; 
 
+// the falling block, gets composed on top of the landed ones.
+// Only a window of 2 bytes x 4 rows, which the compositor moves to the block position.
+FrameBuffer piece;
+uint8_t pieceMem[2*4] = {0,}; 
+
 
 struct Blockgame {
     uint8_t block;
     Tile currentSprite;
-    Tile oldSprite;
+
+    // the current rotation of the block, pre-shifted for every x offset within a byte.
+    // shifted[posX % 8][row] holds the byte at posX / 8, shiftedLo the spill into the next byte.
+    // Costs 8*4 + 3*4 = 44 bytes of RAM, but drawing and collision checks need no shifting anymore.
+    uint8_t shifted[8][4];
+    uint8_t shiftedLo[8 - BG_SHIFT_SPILL][4];
+
     uint8_t posX;
     uint8_t posY;
     uint8_t rotation;
@@ -89,6 +120,12 @@ struct Blockgame {
     uint8_t speedStep;
 
     uint16_t points;
+
+    uint8_t state;
+
+    // bit (31 - x) is set for every full line x, same layout as bg_load_row
+    uint32_t fullLines;
+    uint8_t flashStep;
 } blockgame;
 
 void bg_select_new_block(void) {
@@ -105,16 +142,80 @@ void bg_load_block(void) {
     const Tile* sp = blocks[blockgame.block] + (blockgame.rotation) % 4;
 
     tile_loadFromProgMem(sp, &blockgame.currentSprite);
+
+    // fill the shift cache. Only needed on a new block or rotation
+    for (uint8_t row = 0; row < 4; row++) {
+        uint16_t bits = (uint16_t) blockgame.currentSprite.bytes[row] << 8;
+        for (uint8_t shift = 0; shift < 8; shift++) {
+            blockgame.shifted[shift][row] = bits >> 8;
+            if (shift >= BG_SHIFT_SPILL) {
+                blockgame.shiftedLo[shift - BG_SHIFT_SPILL][row] = bits;
+            }
+            bits >>= 1;
+        }
+    }
 } 
 
+/**
+ * @brief the part of a pre-shifted row which spills over into the next byte
+ */
+uint8_t bg_shifted_lo(uint8_t shift, uint8_t row) {
+    return shift < BG_SHIFT_SPILL ? 0 : blockgame.shiftedLo[shift - BG_SHIFT_SPILL][row];
+}
+
+/**
+ * @brief OR the pre-shifted current block into the given FrameBuffer
+ */
+void bg_place_block(FrameBuffer* pFrameBuffer, uint8_t posX, uint8_t posY) {
+    uint8_t shift = posX % 8;
+    uint8_t col = posX / 8;
+    uint8_t rows = tile_getHeigth(&blockgame.currentSprite);
+    for (uint8_t row = 0; row < rows; row++) {
+        uint8_t i = (posY + row) * pFrameBuffer->widthBytes + col;
+        pFrameBuffer->buffer[i] |= blockgame.shifted[shift][row];
+        if (col < pFrameBuffer->widthBytes - 1) {
+            pFrameBuffer->buffer[i+1] |= bg_shifted_lo(shift, row);
+        }
+    }
+}
+
+/**
+ * @brief erase the block from the piece layer.
+ * It is the only thing on that layer, so the whole window simply gets cleared.
+ */
+void bg_erase_block(void) {
+    for (uint8_t i = 0; i < piece.bufferLen; i++) {
+        piece.buffer[i] = 0;
+    }
+    compositor_markDirty(LAYER_PIECE, (1 << piece.heigth) - 1);
+}
+
+/**
+ * @brief move the falling block on the display to its current position
+ */
+void bg_draw_block(void) {
+    // delete old sprite
+    bg_erase_block();
+
+    // paint new sprite into the window and move the window to the block
+    bg_place_block(&piece, blockgame.posX % 8, 0);
+    compositor_moveLayer(LAYER_PIECE, blockgame.posX / 8, blockgame.posY);
+
+    blockgame.oldPosX = blockgame.posX;
+    blockgame.oldPosY = blockgame.posY;
+    blockgame.oldRotation = blockgame.rotation;
+
+    compositor_render();
+}
+
 /**
  * @brief initialise the block game
  * 
  */
 void startBlockGame(void) {
-    // first we clear the FrameBuffer
-    for (uint8_t i = 0; i < frameBuffer.bufferLen; i++) {
-        frameBuffer.buffer[i] = 0;
+    // first we clear the blocks of a previous game
+    for (uint8_t i = 0; i < sizeof(landedMem); i++) {
+        landedMem[i] = 0;
     }
 
     landed.buffer = landedMem;
@@ -123,6 +224,20 @@ void startBlockGame(void) {
     landed.width = 32;
     landed.widthBytes = 4;
 
+    piece.buffer = pieceMem;
+    piece.bufferLen = sizeof(pieceMem);
+    piece.heigth = 4;
+    piece.width = 16;
+    piece.widthBytes = 2;
+
+    // the game replaces whatever was shown before
+    compositor_setLayer(LAYER_BOARD, &landed);
+    compositor_setLayer(LAYER_PIECE, &piece);
+    compositor_showLayer(LAYER_BACKGROUND, false);
+    compositor_showLayer(LAYER_BOARD, true);
+    compositor_showLayer(LAYER_PIECE, true);
+    compositor_showLayer(LAYER_OVERLAY, false);
+
     blockgame.posX = 0;
     blockgame.posY = 0;
     blockgame.rotation = 0;
@@ -131,20 +246,27 @@ void startBlockGame(void) {
     blockgame.speedStep = 0;
 
     blockgame.points = 0;
+    blockgame.state = BG_STATE_FALLING;
 
     // then load the first sprite
     bg_select_new_block();
     bg_load_block();
 
-    tile_place(&frameBuffer, blockgame.posX, blockgame.posY, &blockgame.currentSprite, true);
-
-    blockgame.oldSprite = blockgame.currentSprite;
-
-    max7219_renderData(&frameBuffer);
-
+    bg_draw_block();
 }
 
 void buttonPressed_BlockGame(uint8_t buttons) {
+    if (blockgame.state == BG_STATE_GAME_OVER) {
+        if (buttons == BUTTON_DOWN_PRESSED) {
+            startBlockGame();
+        }
+        return;
+    }
+    if (blockgame.state != BG_STATE_FALLING) {
+        // the block already landed
+        return;
+    }
+
     switch (buttons) {
         case BUTTON_LEFT_PRESSED:
             if (blockgame.posY < 7) {
@@ -180,19 +302,18 @@ bool bg_collide(void) {
         return true;
     }
 
-    uint8_t cols = tile_getWidth(&blockgame.currentSprite);
+    // check whether the block would overlap the landed ones one step further
+    uint8_t nextX = blockgame.posX + 1;
+    uint8_t shift = nextX % 8;
+    uint8_t col = nextX / 8;
     uint8_t rows = tile_getHeigth(&blockgame.currentSprite);
     for (uint8_t row = 0; row < rows; row++) {
-        for (uint8_t col = cols-1; col >= 0; col--) {
-            if (blockgame.currentSprite.bytes[row] & (0x80>>col)) {
-                // col+1 because we need to check for closeby pixels
-                if (framebuffer_getPixel(&landed, blockgame.posX + col + 1, blockgame.posY + row)) {
-                    return true;
-                }
-                else {
-                    break; // finish inner loop. no need to check further pixels in this column
-                }
-            }
+        uint8_t i = (blockgame.posY + row) * landed.widthBytes + col;
+        if (landed.buffer[i] & blockgame.shifted[shift][row]) {
+            return true;
+        }
+        if (col < landed.widthBytes - 1 && (landed.buffer[i+1] & bg_shifted_lo(shift, row))) {
+            return true;
         }
     }
     return false;
@@ -202,38 +323,155 @@ bool bg_collide(void) {
  * @brief transfer the current sprite to the landed ones
  */
 void bg_update_landed(void) {
-    tile_place(&landed, blockgame.posX, blockgame.posY, &blockgame.currentSprite, false);
+    bg_place_block(&landed, blockgame.posX, blockgame.posY);
+    compositor_markDirty(LAYER_BOARD, ((1 << tile_getHeigth(&blockgame.currentSprite)) - 1) << blockgame.posY);
+
+    // it is part of the landed ones now
+    bg_erase_block();
+}
+
+/**
+ * @brief load a whole row of the given FrameBuffer into 32 bit. Pixel x is bit (31 - x)
+ */
+uint32_t bg_load_row(FrameBuffer* pFrameBuffer, uint8_t row) {
+    uint8_t* pBytes = &pFrameBuffer->buffer[row * pFrameBuffer->widthBytes];
+    return ((uint32_t) pBytes[0] << 24) | ((uint32_t) pBytes[1] << 16) | ((uint16_t) pBytes[2] << 8) | pBytes[3];
+}
+
+void bg_store_row(FrameBuffer* pFrameBuffer, uint8_t row, uint32_t bits) {
+    uint8_t* pBytes = &pFrameBuffer->buffer[row * pFrameBuffer->widthBytes];
+    pBytes[0] = bits >> 24;
+    pBytes[1] = bits >> 16;
+    pBytes[2] = bits >> 8;
+    pBytes[3] = bits;
 }
 
 /**
- * @brief remove every full line
+ * @brief remove the given line bit from a row and shift the pixels left of it to the right
+ */
+uint32_t bg_remove_line(uint32_t bits, uint32_t lineBit) {
+    uint32_t below = lineBit - 1;
+    return (bits & below) | ((bits & ~below & ~lineBit) >> 1);
+}
+
+/**
+ * @brief find all full lines. A line is full if its pixel is set in every row
+ */
+void bg_mark_completed(void) {
+    uint32_t full = 0xFFFFFFFF;
+    for (uint8_t row = 0; row < landed.heigth; row++) {
+        full &= bg_load_row(&landed, row);
+    }
+    blockgame.fullLines = full;
+}
+
+/**
+ * @brief remove a single full line from landed
  */
 void bg_remove_completed(void) {
-    for (uint8_t col = landed.width-1; col >0; col--) {
-        bool colFull=true;
-        for (uint8_t row = 0; row < landed.heigth; row++) {
-            if (!framebuffer_getPixel(&landed, col, row)) {
-                colFull = false;
-            }
+    // lowest bit is the full line closest to the bottom
+    uint32_t lineBit = blockgame.fullLines & -blockgame.fullLines;
+
+    for (uint8_t row = 0; row < landed.heigth; row++) {
+        bg_store_row(&landed, row, bg_remove_line(bg_load_row(&landed, row), lineBit));
+    }
+    compositor_markDirty(LAYER_BOARD, 0xFF);
+
+    // the full lines left of the removed one moved as well
+    blockgame.fullLines = bg_remove_line(blockgame.fullLines, lineBit);
+}
+
+/**
+ * @brief hide or show all full lines.
+ * landed stays untouched, the compositor masks the lines when rendering.
+ */
+void bg_flash_completed(bool hidden) {
+    uint32_t lines = hidden ? blockgame.fullLines : 0;
+    for (uint8_t col = 0; col < landed.widthBytes; col++) {
+        compositor_maskColumns(col, lines >> (24 - col * 8));
+    }
+}
+
+/**
+ * @brief one step of the falling block
+ */
+void bg_step_falling(void) {
+    blockgame.speedStep++;
+
+    if (blockgame.speedStep == blockgame.speed) {
+        blockgame.speedStep = 0;
+
+        // pending moves and rotations from the buttons are already in posY and rotation.
+        // Thus the collision check uses the block as it gets drawn below
+        if (bg_collide()) {
+            blockgame.state = BG_STATE_LOCK;
         }
-        
-        if (colFull) {
-            // remove the line and shift the pixels left of it to the right
-            for (uint8_t rowShift = 0; rowShift < landed.heigth; rowShift++) {
-                for (uint8_t colShift = col; colShift >0; colShift--) {
-                    bool pixelVal = framebuffer_getPixel(&landed, colShift-1, rowShift);
-                    framebuffer_setPixel(&landed, colShift, rowShift, pixelVal);
-
-                    // also update the display frameBuffer
-                    framebuffer_setPixel(&frameBuffer, colShift, rowShift, pixelVal);
-                }
+        else {
+            blockgame.posX++;
+        }
+    }
+
+    // only draw once, no matter whether the block got moved, rotated or fell
+    if (blockgame.oldPosX != blockgame.posX || blockgame.oldPosY != blockgame.posY 
+        || blockgame.oldRotation != blockgame.rotation) {
+        bg_draw_block();
+    }
+}
+
+/**
+ * @brief one step of the landing. Every state only does a bounded amount of work.
+ */
+void bg_step_landing(void) {
+    switch (blockgame.state) {
+        case BG_STATE_LOCK:
+            // the block is drawn at its current position, it only needs to get into landed
+            bg_update_landed();
+            compositor_render();
+
+            if (blockgame.posX <= 1) {
+                // game over!
+                blockgame.state = BG_STATE_GAME_OVER;
+                showScore(blockgame.points);
+                return;
+            }
+            blockgame.state = BG_STATE_MARK;
+            break;
+        case BG_STATE_MARK:
+            bg_mark_completed();
+            blockgame.flashStep = 0;
+            blockgame.state = blockgame.fullLines ? BG_STATE_FLASH : BG_STATE_SPAWN;
+            break;
+        case BG_STATE_FLASH:
+            blockgame.flashStep++;
+            if (blockgame.flashStep % BG_FLASH_STEPS == 0) {
+                bg_flash_completed((blockgame.flashStep / BG_FLASH_STEPS) % 2);
+                compositor_render();
+            }
+            if (blockgame.flashStep == BG_FLASH_STEPS * BG_FLASH_TOGGLES) {
+                // the lines must not stay hidden after compacting
+                bg_flash_completed(false);
+                blockgame.state = BG_STATE_COMPACT;
+            }
+            break;
+        case BG_STATE_COMPACT:
+            // only one line per step
+            bg_remove_completed();
+            compositor_render();
+            if (!blockgame.fullLines) {
+                blockgame.state = BG_STATE_SPAWN;
             }
-            //X max7219_renderData(&frameBuffer);
+            break;
+        case BG_STATE_SPAWN:
+            blockgame.posX = 0;
+            blockgame.posY = 4;
+            blockgame.speedStep = 0;
 
-            // We removed this very row and shifted the bits above. 
-            // Thus we need to handle the very row again next round.
-            col++;
-        }
+            bg_select_new_block();
+            bg_load_block();
+
+            bg_draw_block();
+            blockgame.state = BG_STATE_FALLING;
+            break;
     }
 }
 
@@ -243,57 +481,28 @@ void bg_remove_completed(void) {
  * Get's called once every timer tick
  */
 void task_BlockGame(void){
+    if (blockgame.state == BG_STATE_GAME_OVER) {
+        task_Score();
+        return;
+    }
+
     blockgame.time++;
 
     if (blockgame.time >= 15) {
         blockgame.time = 0;
-        blockgame.speedStep++;
-        
-        bool eraseSprite = true;
-
-        if (blockgame.speedStep == blockgame.speed) {
-            if (bg_collide()) {
-                
-                bg_update_landed();
-
-                bg_remove_completed();
-
-                eraseSprite = false;
-
-                if (blockgame.posX <= 1) {
-                    // game over!
-                    //X TODO 
-                    return;
-                }
-
-                blockgame.posX = 0;
-                blockgame.posY = 4;
-                
-                bg_select_new_block();
-                bg_load_block();
-            }
 
-            blockgame.posX++;
-            blockgame.speedStep = 0;
+#ifdef BG_TIMING_LED
+        // allows to measure the duration of each step on the LED pin
+        SET_LED
+#endif
+        if (blockgame.state == BG_STATE_FALLING) {
+            bg_step_falling();
         }
-
-        if (blockgame.oldPosX != blockgame.posX || blockgame.oldPosY != blockgame.posY 
-            || blockgame.oldRotation != blockgame.rotation) {
-
-            if (eraseSprite) {
-                // delete old sprite
-                tile_erase(&frameBuffer, blockgame.oldPosX, blockgame.oldPosY, &blockgame.oldSprite);
-            }
-
-            // paint new sprite
-            tile_place(&frameBuffer, blockgame.posX, blockgame.posY, &blockgame.currentSprite, false);
-
-            blockgame.oldPosX = blockgame.posX;
-            blockgame.oldPosY = blockgame.posY;
-            blockgame.oldRotation = blockgame.rotation;
-            blockgame.oldSprite = blockgame.currentSprite;
-
-            max7219_renderData(&frameBuffer);
+        else {
+            bg_step_landing();
         }
+#ifdef BG_TIMING_LED
+        CLR_LED
+#endif
     } 
 }
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2018-2025 Mark Struberg
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "main.h"
+
+/**
+ * @brief display compositor.
+ * The frameBuffer is not written directly anymore. Instead every part of the screen
+ * gets drawn into its own 1 bit layer. Each layer tracks which of its rows changed.
+ * At render time only those rows get ORed together into the frameBuffer.
+ * Only the modules whose byte really changed get sent to the MAX7219.
+ */
+
+struct Compositor {
+    FrameBuffer* layers[LAYER_COUNT];
+
+    // bitmask of the display rows which changed, per layer
+    uint8_t dirtyRows[LAYER_COUNT];
+
+    // position of the layer on the display, in bytes and rows.
+    // Allows layers which are smaller than the display
+    uint8_t offsetCol[LAYER_COUNT];
+    uint8_t offsetRow[LAYER_COUNT];
+
+    // bitmask of the layers which get rendered
+    uint8_t visibleLayers;
+
+    // pixels which get cleared in every row after combining the layers, per module
+    uint8_t maskedColumns[MAX7219_MODULE_COUNT];
+    bool maskChanged;
+} compositor;
+
+void compositor_setLayer(uint8_t layer, FrameBuffer* pFrameBuffer) {
+    compositor.layers[layer] = pFrameBuffer;
+    compositor.dirtyRows[layer] = 0xFF;
+}
+
+void compositor_showLayer(uint8_t layer, bool visible) {
+    if (visible) {
+        compositor.visibleLayers |= 1 << layer;
+    }
+    else {
+        compositor.visibleLayers &= ~(1 << layer);
+    }
+    compositor.dirtyRows[layer] = 0xFF;
+}
+
+void compositor_markDirty(uint8_t layer, uint8_t rows) {
+    compositor.dirtyRows[layer] |= rows << compositor.offsetRow[layer];
+}
+
+void compositor_moveLayer(uint8_t layer, uint8_t col, uint8_t row) {
+    // the display rows the layer covered before and covers afterwards both change
+    uint8_t layerRows = (1 << compositor.layers[layer]->heigth) - 1;
+    compositor_markDirty(layer, layerRows);
+    compositor.offsetCol[layer] = col;
+    compositor.offsetRow[layer] = row;
+    compositor_markDirty(layer, layerRows);
+}
+
+void compositor_maskColumns(uint8_t col, uint8_t bits) {
+    if (compositor.maskedColumns[col] != bits) {
+        compositor.maskedColumns[col] = bits;
+        compositor.maskChanged = true;
+    }
+}
+
+/**
+ * @brief send a single row to the MAX7219 modules.
+ * Modules without changes only get a NOOP.
+ * The first word shifted in ends up in the last module of the chain,
+ * thus we start with the last byte of the row, like max7219_renderData.
+ */
+void compositor_sendRow(uint8_t row, uint8_t modules) {
+    uint8_t rowStart = row * frameBuffer.widthBytes;
+    max7219_startDataFrame();
+    for (int8_t module = frameBuffer.widthBytes - 1; module >= 0; module--) {
+        if (modules & (1 << module)) {
+            max7219_sendData(MAX7219_REG_DIGIT0 + row, frameBuffer.buffer[rowStart + module]);
+        }
+        else {
+            max7219_sendData(MAX7219_REG_NOOP, 0);
+        }
+    }
+    max7219_endDataFrame();
+}
+
+void compositor_render(void) {
+    // the mask affects every row
+    uint8_t dirtyRows = compositor.maskChanged ? 0xFF : 0;
+    compositor.maskChanged = false;
+    for (uint8_t layer = 0; layer < LAYER_COUNT; layer++) {
+        dirtyRows |= compositor.dirtyRows[layer];
+        compositor.dirtyRows[layer] = 0;
+    }
+
+    for (uint8_t row = 0; dirtyRows; row++, dirtyRows >>= 1) {
+        if (!(dirtyRows & 0x01)) {
+            continue;
+        }
+
+        uint8_t changedModules = 0;
+        uint8_t rowStart = row * frameBuffer.widthBytes;
+        for (uint8_t col = 0; col < frameBuffer.widthBytes; col++) {
+            uint8_t bits = 0;
+            for (uint8_t layer = 0; layer < LAYER_COUNT; layer++) {
+                FrameBuffer* pLayer = compositor.layers[layer];
+                if (pLayer == NULL || !(compositor.visibleLayers & (1 << layer))) {
+                    continue;
+                }
+
+                // wraps around if we are left of or above the layer
+                uint8_t layerRow = row - compositor.offsetRow[layer];
+                uint8_t layerCol = col - compositor.offsetCol[layer];
+                if (layerRow < pLayer->heigth && layerCol < pLayer->widthBytes) {
+                    bits |= pLayer->buffer[layerRow * pLayer->widthBytes + layerCol];
+                }
+            }
+            bits &= ~compositor.maskedColumns[col];
+
+            if (frameBuffer.buffer[rowStart + col] != bits) {
+                frameBuffer.buffer[rowStart + col] = bits;
+                changedModules |= 1 << col;
+            }
+        }
+
+        if (changedModules) {
+            compositor_sendRow(row, changedModules);
+        }
+    }
+}
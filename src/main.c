@@ -30,6 +30,8 @@
 
 #include "main.h"
 
+#include <avr/pgmspace.h>
+
 #define TASK_LED_bm 0x01
 #define TASK_BUTTON_bm 0x02
 
@@ -52,6 +54,11 @@ FrameBuffer backBuffer;
 uint8_t backBufferMem[(MAX7219_MODULE_COUNT+1)*8]; 
 
 
+// drawn on top of all other layers, e.g. the score
+FrameBuffer overlay;
+uint8_t overlayMem[MAX7219_MODULE_COUNT*8]; 
+
+
 
 /* Menu mode START */
 
@@ -129,6 +136,16 @@ void setup_anzeige(void) {
     backBuffer.heigth=8;
     backBuffer.buffer=backBufferMem;
     backBuffer.bufferLen =  sizeof(backBufferMem);
+
+    overlay.widthBytes = MAX7219_MODULE_COUNT;
+    overlay.width=overlay.widthBytes*8;
+    overlay.heigth=8;
+    overlay.buffer=overlayMem;
+    overlay.bufferLen = sizeof(overlayMem);
+
+    compositor_setLayer(LAYER_BACKGROUND, &backBuffer);
+    compositor_setLayer(LAYER_OVERLAY, &overlay);
+    compositor_showLayer(LAYER_BACKGROUND, true);
 }
 
 static uint16_t counter = 0;
@@ -165,7 +182,8 @@ int drawNextChar(FrameBuffer* pFrameBuffer, char character, uint8_t startXPos, T
     return startXPos; 
 }
 
-char* message = "**  Press the 'Down' button to start the falling block game!  **";
+// kept in flash, the 512 bytes of RAM are precious
+PROGMEM const char message[] = "**  Press the 'Down' button to start the falling block game!  **";
 uint8_t msgPos = 0;
 Tile previousChar = {0,};
 
@@ -184,14 +202,14 @@ void do_laufschrift(void) {
             uint8_t startXPos = lastStartXPos;
             do {
                 lastStartXPos = startXPos;
-                startXPos = drawNextChar(&backBuffer, message[msgPos], startXPos, &previousChar);
+                startXPos = drawNextChar(&backBuffer, pgm_read_byte(&message[msgPos]), startXPos, &previousChar);
 
                 if (startXPos < backBuffer.width) {
                     // otherwise we have to draw that character again next time
                     msgPos++;
                 }
 
-                if (message[msgPos] == 0) {
+                if (pgm_read_byte(&message[msgPos]) == 0) {
                     msgPos = 0;
                 }
             } while (startXPos < backBuffer.width);
@@ -216,16 +234,9 @@ void do_laufschrift(void) {
             shiftPos = 0;
         }
 
-        // now copy the backBuffer to the frameBuffer
-        for (uint8_t row = 0; row < 8; row++) {
-            uint8_t fbRowStart = row*frameBuffer.widthBytes;
-            uint8_t bbRowStart = row*backBuffer.widthBytes;
-            for (int col=0; col < frameBuffer.widthBytes; col++) {
-                frameBuffer.buffer[fbRowStart+col] = backBuffer.buffer[bbRowStart+col];
-            }
-        }
-
-        max7219_renderData(&frameBuffer);
+        // the whole backBuffer got shifted
+        compositor_markDirty(LAYER_BACKGROUND, 0xFF);
+        compositor_render();
         pos++;
     }
 
@@ -344,6 +355,9 @@ int main(void) {
         max7219_sendData(MAX7219_CMD_INTENSITY, 0x00);
     }
     max7219_endDataFrame();
+
+    // from now on the compositor only sends what changed compared to the frameBuffer
+    max7219_renderData(&frameBuffer);
     
     while(1) {
         task_anzeige();
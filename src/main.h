@@ -19,6 +19,9 @@
 // Debugging
 #define DEBUG_ENABLED
 
+// sets the LED pin during every block game step, to measure its duration with a scope
+//#define BG_TIMING_LED
+
 
 
 #include <avr/io.h>
@@ -62,6 +65,11 @@
 
 #define MAX7219_MODULE_COUNT 4
 
+// MAX7219 register addresses as fixed by the datasheet.
+// Row n of a module is written to register MAX7219_REG_DIGIT0 + n.
+#define MAX7219_REG_NOOP 0x00
+#define MAX7219_REG_DIGIT0 0x01
+
 
 // maps directly to the display ram
 extern FrameBuffer frameBuffer;
@@ -72,6 +80,65 @@ extern uint8_t frameBufferMem[MAX7219_MODULE_COUNT*8];
 extern FrameBuffer backBuffer;
 extern uint8_t backBufferMem[(MAX7219_MODULE_COUNT+1)*8]; 
 
+
+// drawn on top of all other layers, e.g. the score
+extern FrameBuffer overlay;
+extern uint8_t overlayMem[MAX7219_MODULE_COUNT*8]; 
+
+
+/**
+ * @brief layers of the compositor, ORed together into the frameBuffer
+ * 
+ */
+#define LAYER_BACKGROUND 0
+#define LAYER_BOARD 1
+#define LAYER_PIECE 2
+#define LAYER_OVERLAY 3
+#define LAYER_COUNT 4
+
+/**
+ * @brief use the given FrameBuffer as layer. 
+ * It might be smaller than the frameBuffer, see compositor_moveLayer
+ * 
+ */
+void compositor_setLayer(uint8_t layer, FrameBuffer* pFrameBuffer);
+
+void compositor_showLayer(uint8_t layer, bool visible);
+
+/**
+ * @brief place the upper left corner of a layer at the given display position.
+ * The rows covered at the old and at the new position get marked dirty.
+ * 
+ * @param layer 
+ * @param col position in bytes, thus the number of the module
+ * @param row 
+ */
+void compositor_moveLayer(uint8_t layer, uint8_t col, uint8_t row);
+
+/**
+ * @brief mark rows of a layer as changed
+ * 
+ * @param layer 
+ * @param rows bitmask of the rows of the layer, bit 0 is the top row of the layer
+ */
+void compositor_markDirty(uint8_t layer, uint8_t rows);
+
+/**
+ * @brief hide pixel columns of a module in all rows, no matter which layer sets them.
+ * The layers themselves stay untouched.
+ * 
+ * @param col the number of the module
+ * @param bits the pixels to hide, MSB is the leftmost pixel. 0 shows all again
+ */
+void compositor_maskColumns(uint8_t col, uint8_t bits);
+
+/**
+ * @brief combine the dirty rows of all visible layers into the frameBuffer
+ * and send the changed bytes to the display
+ * 
+ */
+void compositor_render(void);
+
 /* DISPLAY END  */
 
 /**
@@ -88,4 +155,16 @@ void task_BlockGame(void);
 
 void buttonPressed_BlockGame(uint8_t buttons);
 
+/**
+ * @brief show the score screen and count up to the given points
+ * 
+ */
+void showScore(uint16_t points);
+
+/**
+ * @brief permanent task for the score screen
+ * 
+ */
+void task_Score(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2018-2025 Mark Struberg
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "main.h"
+
+#include <avr/pgmspace.h>
+
+/**
+ * @brief score screen shown when the block game is over.
+ * The display is in the normal (landscape) orientation again, like the scrolling text.
+ *
+ * The digits are taken from FontBig.ods and pre-rendered as fixed width column strips.
+ * Each digit cell is SCORE_DIGIT_WIDTH pixels wide and always 8 pixels high.
+ * Thus a digit can be blitted without loading a font tile and without any collision check.
+ * The score gets drawn into the overlay layer.
+ * If the score changes, only the changed digits get blitted and only the rows
+ * which really changed get marked dirty. The compositor then only sends those
+ * rows to the MAX7219 modules whose bytes changed.
+ */
+
+// 65535 is the max score
+#define SCORE_DIGITS 5
+#define SCORE_DIGIT_WIDTH 6
+#define SCORE_START_X 1
+
+// the pixels of one digit cell, left aligned in 16 bit
+#define SCORE_CELL_MASK 0xFC00
+
+// marks a digit cell which shows nothing (leading zeros)
+#define SCORE_BLANK 0xFF
+
+PROGMEM const uint8_t scoreDigits[10][8] = {
+    {0x60,0x90,0xB0,0xF0,0xD0,0x90,0x60,0x00},
+    {0x20,0x60,0xE0,0xA0,0x20,0x20,0xF0,0x00},
+    {0x70,0xF8,0x98,0x30,0x60,0xC0,0xF8,0x00},
+    {0x60,0x90,0x10,0x20,0x10,0x90,0x60,0x00},
+    {0x10,0x30,0x60,0xC0,0xF0,0x20,0x20,0x00},
+    {0xF0,0x80,0x80,0xE0,0x10,0x90,0x60,0x00},
+    {0x60,0x90,0x80,0xE0,0x90,0x90,0x60,0x00},
+    {0xF0,0x30,0x20,0x60,0x40,0xC0,0xC0,0x00},
+    {0x60,0x90,0x90,0x60,0x90,0x90,0x60,0x00},
+    {0x60,0x90,0x90,0x70,0x10,0x90,0x60,0x00},
+};
+
+struct Score {
+    // the score which is currently on the display
+    uint16_t value;
+
+    // the score we count up to
+    uint16_t target;
+
+    // the digit currently shown in each cell, most significant first
+    uint8_t digits[SCORE_DIGITS];
+
+    uint8_t time;
+} score;
+
+uint8_t score_digitRow(uint8_t digit, uint8_t row) {
+    if (digit == SCORE_BLANK) {
+        return 0;
+    }
+    return pgm_read_byte(&scoreDigits[digit][row]);
+}
+
+/**
+ * @brief blit a single digit into its cell of the overlay
+ *
+ * Only rows which differ from the previously shown digit get touched.
+ */
+void score_blitDigit(uint8_t cell, uint8_t digit) {
+    uint8_t oldDigit = score.digits[cell];
+    if (oldDigit == digit) {
+        return;
+    }
+    score.digits[cell] = digit;
+
+    uint8_t x = SCORE_START_X + cell * SCORE_DIGIT_WIDTH;
+    uint8_t module = x / 8;
+    uint8_t shift = x % 8;
+
+    // the cell might span 2 modules
+    uint16_t cellMask = SCORE_CELL_MASK >> shift;
+    uint8_t maskHi = cellMask >> 8;
+    uint8_t maskLo = cellMask & 0xFF;
+
+    for (uint8_t row = 0; row < 8; row++) {
+        uint8_t newBits = score_digitRow(digit, row);
+        if (newBits == score_digitRow(oldDigit, row)) {
+            continue;
+        }
+
+        uint16_t bits = ((uint16_t) newBits << 8) >> shift;
+        uint8_t rowStart = row * overlay.widthBytes;
+
+        overlay.buffer[rowStart + module] = (overlay.buffer[rowStart + module] & ~maskHi) | (bits >> 8);
+        if (maskLo) {
+            overlay.buffer[rowStart + module + 1] = (overlay.buffer[rowStart + module + 1] & ~maskLo) | (bits & 0xFF);
+        }
+        compositor_markDirty(LAYER_OVERLAY, 1 << row);
+    }
+}
+
+/**
+ * @brief blit all digits of the given value which changed
+ */
+void score_blitValue(uint16_t value) {
+    for (int8_t cell = SCORE_DIGITS - 1; cell >= 0; cell--) {
+        // always show at least the last digit, even if the score is 0
+        bool leadingZero = value == 0 && cell < SCORE_DIGITS - 1;
+        score_blitDigit(cell, leadingZero ? SCORE_BLANK : value % 10);
+        value /= 10;
+    }
+}
+
+void showScore(uint16_t points) {
+    for (uint8_t i = 0; i < overlay.bufferLen; i++) {
+        overlay.buffer[i] = 0;
+    }
+
+    for (uint8_t cell = 0; cell < SCORE_DIGITS; cell++) {
+        score.digits[cell] = SCORE_BLANK;
+    }
+
+    score.target = points;
+    score.time = 0;
+
+    score.value = 0;
+    score_blitValue(0);
+
+    // only the score is left on the display
+    compositor_showLayer(LAYER_BOARD, false);
+    compositor_showLayer(LAYER_PIECE, false);
+    compositor_showLayer(LAYER_OVERLAY, true);
+    compositor_render();
+}
+
+void task_Score(void) {
+    if (score.value == score.target) {
+        return;
+    }
+
+    score.time++;
+    if (score.time < 15) {
+        return;
+    }
+    score.time = 0;
+
+    // count up fast at first and slow down when we come closer to the final score
+    score.value += (score.target - score.value + 15) / 16;
+
+    score_blitValue(score.value);
+    compositor_render();
+}